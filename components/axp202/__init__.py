@@ -1,13 +1,18 @@
 import logging
 
-from esphome import pins
+from esphome import automation, pins
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
 from esphome.components import i2c
+from esphome.components.i2c_scheduler import CONF_I2C_SCHEDULER_ID, I2CScheduler
 
 from esphome.const import (
     CONF_INTERRUPT_PIN,
     CONF_ID,
+    CONF_HYSTERESIS,
+    CONF_MAX_TEMPERATURE,
+    CONF_SIZE,
     CONF_SPEAKER,
 )
 
@@ -25,6 +30,59 @@ AXP202Component = axp202_ns.class_(
 
 CONF_AXP202_ID = "axp202_id"
 CONF_BACKLIGHT = "backlight"
+CONF_SAMPLE_BUFFER = "sample_buffer"
+CONF_PUBLISH_EVERY = "publish_every"
+CONF_LEVEL_CHANGE = "level_change"
+CONF_ON_PUBLISH_DUE = "on_publish_due"
+CONF_ON_SAMPLE = "on_sample"
+CONF_ON_PUBLISHED = "on_published"
+CONF_PUBLISH_TIMEOUT = "publish_timeout"
+CONF_ON_PUBLISH_FAILED = "on_publish_failed"
+CONF_CHARGE_CURRENT = "charge_current"
+CONF_CHARGE_CONTROL = "charge_control"
+CONF_THROTTLED_CURRENT = "throttled_current"
+CONF_MIN_TS_VOLTAGE = "min_ts_voltage"
+CONF_TS_HYSTERESIS = "ts_hysteresis"
+
+
+def charge_current(value):
+    """AXP202 charge current is 300mA to 1800mA in 100mA steps"""
+    value = cv.current(value)
+    milliamps = int(round(value * 1000))
+    if milliamps < 300 or milliamps > 1800 or milliamps % 100:
+        raise cv.Invalid("Charge current must be 300mA to 1800mA in steps of 100mA")
+    return milliamps
+
+
+CHARGE_CONTROL_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_THROTTLED_CURRENT, default="300mA"): charge_current,
+        # PMU die temperature
+        cv.Optional(CONF_MAX_TEMPERATURE, default="60°C"): cv.temperature,
+        # TS pin voltage, the battery NTC pulls it down as it warms. 0 to ignore it
+        cv.Optional(CONF_MIN_TS_VOLTAGE, default="0V"): cv.voltage,
+        cv.Optional(CONF_HYSTERESIS, default="5°C"): cv.temperature_delta,
+        cv.Optional(CONF_TS_HYSTERESIS, default="50mV"): cv.voltage,
+    }
+)
+
+SAMPLE_BUFFER_SCHEMA = cv.Schema(
+    {
+        # 12 bytes of RTC slow memory each
+        cv.Optional(CONF_SIZE, default=32): cv.int_range(min=2, max=128),
+        cv.Optional(CONF_PUBLISH_EVERY, default=10): cv.int_range(min=1, max=65535),
+        cv.Optional(CONF_LEVEL_CHANGE, default=5): cv.int_range(min=1, max=100),
+        cv.Optional(CONF_ON_PUBLISH_DUE): automation.validate_automation(single=True),
+        cv.Optional(CONF_ON_SAMPLE): automation.validate_automation(single=True),
+        cv.Optional(CONF_ON_PUBLISHED): automation.validate_automation(single=True),
+        cv.Optional(
+            CONF_PUBLISH_TIMEOUT, default="60s"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_ON_PUBLISH_FAILED): automation.validate_automation(
+            single=True
+        ),
+    }
+)
 
 CONFIG_SCHEMA = (
     cv.Schema(
@@ -35,6 +93,12 @@ CONFIG_SCHEMA = (
             cv.Optional(CONF_INTERRUPT_PIN): cv.All(
                 pins.internal_gpio_input_pin_schema
             ),
+            cv.Optional(CONF_I2C_SCHEDULER_ID): cv.use_id(I2CScheduler),
+            cv.Optional(CONF_CHARGE_CURRENT, default="300mA"): charge_current,
+            cv.Optional(CONF_CHARGE_CONTROL): CHARGE_CONTROL_SCHEMA,
+            cv.Optional(CONF_SAMPLE_BUFFER): cv.All(
+                SAMPLE_BUFFER_SCHEMA, cv.only_on_esp32
+            ),
         }
     )
     .extend(i2c.i2c_device_schema(0x35))
@@ -42,6 +106,20 @@ CONFIG_SCHEMA = (
 )
 
 
+def _final_validate(config):
+    # The buffer is a single block of RTC memory sized by a global define
+    full_config = fv.full_config.get()
+    buffered = [
+        conf for conf in full_config.get("axp202", []) if CONF_SAMPLE_BUFFER in conf
+    ]
+    if len(buffered) > 1:
+        raise cv.Invalid(f"{CONF_SAMPLE_BUFFER} can only be set on one axp202")
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
@@ -59,3 +137,44 @@ async def to_code(config):
     if interrupt_pin_config := config.get(CONF_INTERRUPT_PIN):
         interrupt_pin = await cg.gpio_pin_expression(interrupt_pin_config)
         cg.add(var.set_interrupt_pin(interrupt_pin))
+
+    cg.add(var.set_charge_current(config[CONF_CHARGE_CURRENT]))
+    if charge_control := config.get(CONF_CHARGE_CONTROL):
+        cg.add(var.set_charge_policy(True))
+        cg.add(var.set_throttled_current(charge_control[CONF_THROTTLED_CURRENT]))
+        cg.add(var.set_max_temperature(charge_control[CONF_MAX_TEMPERATURE]))
+        cg.add(var.set_min_ts_voltage(charge_control[CONF_MIN_TS_VOLTAGE]))
+        cg.add(var.set_temperature_hysteresis(charge_control[CONF_HYSTERESIS]))
+        cg.add(var.set_ts_hysteresis(charge_control[CONF_TS_HYSTERESIS]))
+
+    if scheduler_id := config.get(CONF_I2C_SCHEDULER_ID):
+        cg.add(var.set_scheduler(await cg.get_variable(scheduler_id)))
+
+    if sample_buffer := config.get(CONF_SAMPLE_BUFFER):
+        cg.add_define("USE_AXP202_SAMPLE_BUFFER")
+        cg.add_define("AXP202_SAMPLE_BUFFER_SIZE", sample_buffer[CONF_SIZE])
+        cg.add(var.set_publish_every(sample_buffer[CONF_PUBLISH_EVERY]))
+        cg.add(var.set_level_change(sample_buffer[CONF_LEVEL_CHANGE]))
+        if conf := sample_buffer.get(CONF_ON_PUBLISH_DUE):
+            await automation.build_automation(var.get_publish_due_trigger(), [], conf)
+        if conf := sample_buffer.get(CONF_ON_SAMPLE):
+            await automation.build_automation(
+                var.get_sample_trigger(),
+                [
+                    (cg.uint32, "timestamp"),
+                    (cg.float_, "battery_voltage"),
+                    (cg.float_, "battery_current"),
+                    (cg.uint8, "battery_level"),
+                    (cg.float_, "bus_voltage"),
+                    (cg.bool_, "charging"),
+                    (cg.bool_, "usb"),
+                ],
+                conf,
+            )
+        if conf := sample_buffer.get(CONF_ON_PUBLISHED):
+            await automation.build_automation(var.get_published_trigger(), [], conf)
+        cg.add(var.set_publish_timeout(sample_buffer[CONF_PUBLISH_TIMEOUT]))
+        if conf := sample_buffer.get(CONF_ON_PUBLISH_FAILED):
+            await automation.build_automation(
+                var.get_publish_failed_trigger(), [], conf
+            )
@@ -1,25 +1,80 @@
 #include "axp202.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esp_sleep.h"
 
+#include <cinttypes>
+#include <cmath>
+
+#ifdef USE_EVENT_TRACE
+#include "esphome/components/event_trace/event_trace.h"
+#endif
+#ifdef USE_AXP202_SAMPLE_BUFFER
+#include <ctime>
+#include "esp_attr.h"
+#ifdef USE_API
+#include "esphome/components/api/api_server.h"
+#endif
+#endif
+
 namespace esphome {
 namespace axp202 {
 
 static const char *TAG = "axp202.sensor";
 
+#ifdef USE_I2C_SCHEDULER
+#define AXP202_BUS_LOCK() i2c_scheduler::BusLock bus_lock(this->scheduler_, i2c_scheduler::PRIORITY_BACKGROUND)
+#else
+#define AXP202_BUS_LOCK()
+#endif
+
+#ifdef USE_EVENT_TRACE
+#define AXP202_TRACE(event, arg0, arg1) event_trace::record(event_trace::event, arg0, arg1)
+#else
+#define AXP202_TRACE(event, arg0, arg1)
+#endif
+
+#ifdef USE_AXP202_SAMPLE_BUFFER
+static RTC_DATA_ATTR AXP202SampleBuffer sample_buffer;
+#endif
+
 void AXP202Component::setup() {
   ESP_LOGD(TAG, "Starting up");
   begin(false, false);
 
+#ifdef USE_AXP202_SAMPLE_BUFFER
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    // Not a wake from deep sleep, the buffer is empty and there is nothing to compare against
+    this->publish_due_ = true;
+  } else {
+    sample_buffer.wakes++;
+  }
+  /* One sample per wake regardless of update_interval, the first update()
+   * is randomly delayed and can land after a short run_duration has ended.
+   * Deferred so on_publish_due only fires once Wi-Fi and friends are set up.
+   */
+  this->defer([this]() { this->bufferSample(); });
+#endif
+
   if (this->interrupt_pin_ != nullptr) {
     ESP_LOGD(TAG, "Setting interrupt");
     this->interrupt_pin_->pin_mode(gpio::FLAG_INPUT | gpio::FLAG_PULLUP);
     this->interrupt_pin_->setup();
     this->store_.irq = this->interrupt_pin_->to_isr();
+    this->store_.component = this;
     this->interrupt_pin_->attach_interrupt(AXP202Store::gpio_intr, &this->store_, gpio::INTERRUPT_FALLING_EDGE);
+    // begin() cleared everything, only service now if the line is somehow still held
+    this->store_.trigger = !this->store_.irq.digital_read();
   } else {
     ESP_LOGW(TAG, "No interrupt pin configured!");
   }
+
+  // begin() wrote the full setpoint, don't wait for the first update() if it is already hot on USB
+  applyChargePolicy();
+
+  // loop() only has work after an interrupt, which re-enables it
+  if (!this->store_.trigger)
+    this->disable_loop();
 }
 
 void AXP202Component::publishCharging() {
@@ -39,26 +94,28 @@ void AXP202Component::checkInterrupts() {
   ESP_LOGV(TAG, "Checking IRQs");
 
   bool force_charging_update = false;
-  uint8_t irq = Read8bit(0x48);  // IRQ1
-  ESP_LOGD(TAG, "IRQ1: 0x%02x", irq);
+  uint8_t irq1 = Read8bit(0x48);  // IRQ1
+  uint8_t irq2 = Read8bit(0x49);  // IRQ2
+  uint8_t irq3 = Read8bit(0x4a);  // IRQ3
+  ESP_LOGV(TAG, "IRQ1: 0x%02x IRQ2: 0x%02x IRQ3: 0x%02x", irq1, irq2, irq3);
+  AXP202_TRACE(AXP202_IRQ, (irq2 << 8) | irq1, irq3);
 
-  if (irq & 0b1100) {
+  if (irq1 & 0b1100) {
     // USB changed
     this->publishUsb();
     force_charging_update = true;
   }
 
-  irq = Read8bit(0x49);  // IRQ2
-  ESP_LOGD(TAG, "IRQ2: 0x%02x", irq);
-
-  if (force_charging_update || (irq & 0b1100)) {
+  if (force_charging_update || (irq2 & 0b1100)) {
     // Charging changed
     this->publishCharging();
   }
 
-  irq = Read8bit(0x4a);  // IRQ3
-  ESP_LOGD(TAG, "IRQ3: 0x%02x", irq);
-  if (irq & 0x3) {
+  if (force_charging_update) {
+    this->applyChargePolicy();
+  }
+
+  if (irq3 & 0x3) {
     this->pek_press_ = 16;
 
     if (this->button_) {
@@ -71,9 +128,16 @@ void AXP202Component::checkInterrupts() {
 
 void AXP202Component::loop() {
   if (this->store_.trigger) {
-    ESP_LOGI(TAG, "Servicing interrupt");
-    checkInterrupts();
+    // Clear before servicing so an edge that lands meanwhile gets its own pass
     this->store_.trigger = false;
+    ESP_LOGV(TAG, "Servicing interrupt");
+    checkInterrupts();
+
+    /* IRQ is held low until every flag is cleared, so a source raised
+     * between reading and clearing the flags never makes a new edge.
+     */
+    if (!this->store_.irq.digital_read())
+      this->store_.trigger = true;
   }
 
   if (this->pek_press_ > 0) {
@@ -83,9 +147,15 @@ void AXP202Component::loop() {
       this->button_->publish_state(false);
     }
   }
+
+  if (!this->store_.trigger && this->pek_press_ == 0)
+    this->disable_loop();
 }
 
-void AXP202Store::gpio_intr(AXP202Store *store) { store->trigger = true; }
+void IRAM_ATTR AXP202Store::gpio_intr(AXP202Store *store) {
+  store->trigger = true;
+  store->component->enable_loop_soon_any_context();
+}
 
 void AXP202Component::dump_config() {
   ESP_LOGCONFIG(TAG, "AXP202:");
@@ -101,12 +171,43 @@ void AXP202Component::dump_config() {
   LOG_BINARY_SENSOR("  ", "Vusb usable:", this->usb_);
   LOG_BINARY_SENSOR("  ", "PEK (button) usable:", this->button_);
 
+#ifdef USE_AXP202_SAMPLE_BUFFER
+  ESP_LOGCONFIG(TAG, "  Sample Buffer: %u samples, publish every %u wakes or %u%% change",
+                AXP202_SAMPLE_BUFFER_SIZE, this->publish_every_, this->level_change_);
+#endif
+  ESP_LOGCONFIG(TAG, "  Charge Current: %umA", this->charge_current_);
+  if (this->charge_policy_) {
+    ESP_LOGCONFIG(TAG, "  Charge Policy: throttle to %umA at %.1fC (TS %.3fV), %.1fC / %.3fV hysteresis",
+                  this->throttled_current_, this->max_temperature_, this->min_ts_voltage_,
+                  this->temperature_hysteresis_, this->ts_hysteresis_);
+  }
   LOG_UPDATE_INTERVAL(this);
 }
 
 float AXP202Component::get_setup_priority() const { return setup_priority::DATA; }
 
 void AXP202Component::update() {
+#ifdef USE_I2C_SCHEDULER
+  // Wait for a gap in the touch traffic
+  if (this->scheduler_ != nullptr) {
+    this->scheduler_->submit([this]() { this->publishSensors(); });
+    return;
+  }
+#endif
+  publishSensors();
+}
+
+void AXP202Component::publishSensors() {
+  applyChargePolicy();
+
+#ifdef USE_AXP202_SAMPLE_BUFFER
+  // The wake already has its boot sample unless this update comes a good while after it
+  if (this->sampled_ && millis() - this->last_sample_ms_ < this->get_update_interval() / 2) {
+    ESP_LOGV(TAG, "Skipping sample, wake sample is %" PRIu32 "ms old", millis() - this->last_sample_ms_);
+    return;
+  }
+  bufferSample();
+#else
   bool batt_present = GetBatState();
   bool bus_present = GetVBusState();
 
@@ -156,6 +257,157 @@ void AXP202Component::update() {
   }
 
   // UpdateBrightness();
+#endif
+}
+
+#ifdef USE_AXP202_SAMPLE_BUFFER
+void AXP202Component::bufferSample() {
+  AXP202Sample sample{};
+  sample.timestamp = ::time(nullptr);
+  if (GetBatState()) {
+    sample.flags |= SAMPLE_BATTERY;
+    sample.vbat_raw = Read12Bit(0x78);
+    sample.idischarge_raw = Read13Bit(0x7C);
+    sample.level = GetFuelGauge();
+  }
+  if (Read8bit(0x1) & 0x40)
+    sample.flags |= SAMPLE_CHARGING;
+  if (GetVBusState()) {
+    sample.flags |= SAMPLE_VBUS;
+    sample.vbus_raw = Read12Bit(0x5A);
+  }
+
+  // Full, drop the oldest
+  if (sample_buffer.count == AXP202_SAMPLE_BUFFER_SIZE) {
+    sample_buffer.start = (sample_buffer.start + 1) % AXP202_SAMPLE_BUFFER_SIZE;
+    sample_buffer.count--;
+  }
+  sample_buffer.samples[(sample_buffer.start + sample_buffer.count) % AXP202_SAMPLE_BUFFER_SIZE] = sample;
+  sample_buffer.count++;
+  this->sampled_ = true;
+  this->last_sample_ms_ = millis();
+  ESP_LOGV(TAG, "Buffered sample %u/%u, wake %u", sample_buffer.count, AXP202_SAMPLE_BUFFER_SIZE,
+           sample_buffer.wakes);
+
+  int level_delta = (int) sample.level - (int) sample_buffer.last_level;
+  this->publish_due_ |= sample_buffer.wakes >= this->publish_every_ ||
+                        sample_buffer.count == AXP202_SAMPLE_BUFFER_SIZE ||
+                        (level_delta < 0 ? -level_delta : level_delta) >= this->level_change_ ||
+                        ((sample.flags ^ sample_buffer.last_flags) & (SAMPLE_CHARGING | SAMPLE_VBUS));
+
+  if (!this->publish_due_ || this->flush_pending_)
+    return;
+
+  ESP_LOGD(TAG, "Publish due, %u samples buffered", sample_buffer.count);
+  this->flush_pending_ = true;
+  this->publish_due_trigger_.trigger();
+
+  // Wait for somewhere to publish to, the trigger has just asked for the radio
+  this->set_interval("flush", 500, [this]() {
+#ifdef USE_API
+    if (api::global_api_server == nullptr || !api::global_api_server->is_connected())
+      return;
+#endif
+    this->cancel_interval("flush");
+    this->cancel_timeout("flush_timeout");
+    this->flushSamples();
+  });
+  // Out of range the radio would search until the battery is flat, give up and keep the backlog
+  this->set_timeout("flush_timeout", this->publish_timeout_, [this]() {
+    ESP_LOGW(TAG, "Could not publish within %" PRIu32 "ms, keeping %u samples", this->publish_timeout_,
+             sample_buffer.count);
+    this->cancel_interval("flush");
+    this->flush_pending_ = false;
+    this->publish_failed_trigger_.trigger();
+  });
+}
+
+void AXP202Component::flushSamples() {
+  ESP_LOGD(TAG, "Publishing %u buffered samples", sample_buffer.count);
+  const AXP202Sample *newest = nullptr;
+  for (uint16_t i = 0; i < sample_buffer.count; i++) {
+    newest = &sample_buffer.samples[(sample_buffer.start + i) % AXP202_SAMPLE_BUFFER_SIZE];
+    bool battery = newest->flags & SAMPLE_BATTERY;
+    bool vbus = newest->flags & SAMPLE_VBUS;
+    bool charging = newest->flags & SAMPLE_CHARGING;
+    this->sample_trigger_.trigger(newest->timestamp, battery ? newest->vbat_raw * 1.1f / 1000.0f : NAN,
+                                  battery && !charging ? newest->idischarge_raw * 0.5f : NAN, newest->level,
+                                  vbus ? newest->vbus_raw * 1.7f / 1000.0f : NAN, charging, vbus);
+  }
+
+  if (newest != nullptr) {
+    publishSample(*newest);
+    sample_buffer.last_level = newest->level;
+    sample_buffer.last_flags = newest->flags;
+  }
+  sample_buffer.start = 0;
+  sample_buffer.count = 0;
+  sample_buffer.wakes = 0;
+  this->publish_due_ = false;
+  this->flush_pending_ = false;
+  this->published_trigger_.trigger();
+}
+
+/* Same rules as publishSensors(), from a buffered reading. The charging
+ * and USB binary sensors are left alone, the IRQ path keeps them live and
+ * a buffered flag could be older than what they already show.
+ */
+void AXP202Component::publishSample(const AXP202Sample &sample) {
+  bool batt_present = sample.flags & SAMPLE_BATTERY;
+  bool bus_present = sample.flags & SAMPLE_VBUS;
+  bool charging = sample.flags & SAMPLE_CHARGING;
+
+  if (this->bus_voltage_sensor_ != nullptr)
+    this->bus_voltage_sensor_->publish_state(bus_present ? sample.vbus_raw * 1.7f / 1000.0f : NAN);
+  if (this->battery_voltage_sensor_ != nullptr)
+    this->battery_voltage_sensor_->publish_state(batt_present ? sample.vbat_raw * 1.1f / 1000.0f : NAN);
+  if (this->battery_current_sensor_ != nullptr)
+    this->battery_current_sensor_->publish_state(batt_present && !charging ? sample.idischarge_raw * 0.5f : NAN);
+  if (this->battery_level_sensor_ != nullptr)
+    this->battery_level_sensor_->publish_state(batt_present && sample.level <= 100 ? float(sample.level) : NAN);
+}
+#endif
+
+void AXP202Component::apply_charge_current(uint16_t charge_current) {
+  this->charge_current_ = charge_current;
+  if (this->charge_policy_) {
+    applyChargePolicy();
+  } else {
+    SetChargeCurrent((charge_current - 300) / 100);
+    this->applied_charge_current_ = charge_current;
+  }
+}
+
+void AXP202Component::applyChargePolicy() {
+  if (!this->charge_policy_)
+    return;
+
+  // Only matters while there is something to charge from
+  if (!GetVBusState())
+    return;
+
+  float internal = GetTempInternal();
+  float ts = this->min_ts_voltage_ > 0.0f ? GetTsVoltage() : NAN;
+  // NTC voltage falls as it warms, so it has to climb back above the threshold
+  float ts_release = this->min_ts_voltage_ + this->ts_hysteresis_;
+
+  if (this->charge_throttled_) {
+    this->charge_throttled_ =
+        internal > this->max_temperature_ - this->temperature_hysteresis_ || (!std::isnan(ts) && ts < ts_release);
+  } else {
+    this->charge_throttled_ = internal >= this->max_temperature_ || (!std::isnan(ts) && ts <= this->min_ts_voltage_);
+  }
+
+  uint16_t target = this->charge_current_;
+  if (this->charge_throttled_ && this->throttled_current_ < target)
+    target = this->throttled_current_;
+  if (target == this->applied_charge_current_)
+    return;
+
+  ESP_LOGD(TAG, "Charge current %umA -> %umA (internal %.1fC, TS %.3fV)", this->applied_charge_current_, target,
+           internal, ts);
+  SetChargeCurrent((target - 300) / 100);
+  this->applied_charge_current_ = target;
 }
 
 void AXP202Component::clearInterrupts() {
@@ -183,8 +435,9 @@ void AXP202Component::begin(bool disableLDO2, bool disableLDO3) {
   // Enable bat detection, CHGLED disabled (there isn't one)
   Write1Byte(0x32, 0x46);
 
-  // Bat charge voltage to 4.2, Current 300mA (1C of 380mAh bat)
-  Write1Byte(0x33, 0xc0);
+  // Bat charge voltage to 4.2, Current as configured, default 300mA (1C of 380mAh bat)
+  Write1Byte(0x33, 0xc0 | ((this->charge_current_ - 300) / 100));
+  this->applied_charge_current_ = this->charge_current_;
 
   // Configure button presses, 128mS startup time, 1S for a long press, PWROK after 64mS, shutdown on 4s press
   Write1Byte(0x36, 0x02);
@@ -234,9 +487,13 @@ void AXP202Component::begin(bool disableLDO2, bool disableLDO3) {
   publishUsb();
 }
 
-bool AXP202Component::Write1Byte(uint8_t Addr, uint8_t Data) { return this->write_byte(Addr, Data); }
+bool AXP202Component::Write1Byte(uint8_t Addr, uint8_t Data) {
+  AXP202_BUS_LOCK();
+  return this->write_byte(Addr, Data);
+}
 
 uint8_t AXP202Component::Read8bit(uint8_t Addr) {
+  AXP202_BUS_LOCK();
   uint8_t data;
   this->read_byte(Addr, &data);
   return data;
@@ -261,7 +518,7 @@ uint16_t AXP202Component::Read13Bit(uint8_t Addr) {
 uint16_t AXP202Component::Read16bit(uint8_t Addr) {
   uint32_t ReData = 0;
   uint8_t Buff[2];
-  this->read_bytes(Addr, Buff, sizeof(Buff));
+  ReadBuff(Addr, sizeof(Buff), Buff);
   for (int i = 0; i < sizeof(Buff); i++) {
     ReData <<= 8;
     ReData |= Buff[i];
@@ -272,7 +529,7 @@ uint16_t AXP202Component::Read16bit(uint8_t Addr) {
 uint32_t AXP202Component::Read24bit(uint8_t Addr) {
   uint32_t ReData = 0;
   uint8_t Buff[3];
-  this->read_bytes(Addr, Buff, sizeof(Buff));
+  ReadBuff(Addr, sizeof(Buff), Buff);
   for (int i = 0; i < sizeof(Buff); i++) {
     ReData <<= 8;
     ReData |= Buff[i];
@@ -283,7 +540,7 @@ uint32_t AXP202Component::Read24bit(uint8_t Addr) {
 uint32_t AXP202Component::Read32bit(uint8_t Addr) {
   uint32_t ReData = 0;
   uint8_t Buff[4];
-  this->read_bytes(Addr, Buff, sizeof(Buff));
+  ReadBuff(Addr, sizeof(Buff), Buff);
   for (int i = 0; i < sizeof(Buff); i++) {
     ReData <<= 8;
     ReData |= Buff[i];
@@ -291,7 +548,10 @@ uint32_t AXP202Component::Read32bit(uint8_t Addr) {
   return ReData;
 }
 
-void AXP202Component::ReadBuff(uint8_t Addr, uint8_t Size, uint8_t *Buff) { this->read_bytes(Addr, Buff, Size); }
+void AXP202Component::ReadBuff(uint8_t Addr, uint8_t Size, uint8_t *Buff) {
+  AXP202_BUS_LOCK();
+  this->read_bytes(Addr, Buff, Size);
+}
 
 void AXP202Component::UpdateBrightness() {
   ESP_LOGV(TAG, "Brightness=%f (Curr: %f)", brightness_, curr_brightness_);
@@ -321,7 +581,8 @@ bool AXP202Component::GetBatState() {
 
 uint8_t AXP202Component::GetFuelGauge() {
   uint8_t fuel = Read8bit(0xb9);
-  ESP_LOGD(TAG, "Got Battery Level=%d", fuel);
+  ESP_LOGV(TAG, "Got Battery Level=%d", fuel);
+  AXP202_TRACE(AXP202_FUEL_GAUGE, fuel, 0);
   if (fuel & 0x80) {
     return 0;
   }
@@ -360,6 +621,12 @@ float AXP202Component::GetTempInternal() {
   return OFFSET_DEG_C + ReData * ADCLSB;
 }
 
+float AXP202Component::GetTsVoltage() {
+  float ADCLSB = 0.8 / 1000.0;
+  uint16_t ReData = Read12Bit(0x62);
+  return ReData * ADCLSB;
+}
+
 void AXP202Component::SetLDO2(bool State) {
   uint8_t buf = Read8bit(0x12);
   if (State == true) {
@@ -394,9 +661,10 @@ void AXP202Component::SetLDO4(bool State) {
   Write1Byte(0x12, buf);
 }
 
+// Icharge = 300mA + current * 100mA, up to 1800mA
 void AXP202Component::SetChargeCurrent(uint8_t current) {
   uint8_t buf = Read8bit(0x33);
-  buf = (buf & 0xf0) | (current & 0x07);
+  buf = (buf & 0xf0) | (current & 0x0f);
   Write1Byte(0x33, buf);
 }
 
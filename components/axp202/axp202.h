@@ -1,21 +1,55 @@
 #pragma once
 
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/gpio.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
 #include "esphome/components/i2c/i2c.h"
+#ifdef USE_I2C_SCHEDULER
+#include "esphome/components/i2c_scheduler/i2c_scheduler.h"
+#endif
 
 namespace esphome {
 namespace axp202 {
 
 struct AXP202Store {
   ISRInternalGPIOPin irq;
-  volatile bool trigger{true};
+  volatile bool trigger{false};
+  Component *component{nullptr};
 
   static void gpio_intr(AXP202Store *store);
 };
 
+#ifdef USE_AXP202_SAMPLE_BUFFER
+enum AXP202SampleFlag : uint8_t {
+  SAMPLE_BATTERY = 1 << 0,
+  SAMPLE_CHARGING = 1 << 1,
+  SAMPLE_VBUS = 1 << 2,
+};
+
+/// One periodic reading, raw ADC values to keep it small in RTC memory.
+struct AXP202Sample {
+  uint32_t timestamp;  // epoch seconds, as good as the system clock was at the time
+  uint16_t vbat_raw;
+  uint16_t idischarge_raw;
+  uint16_t vbus_raw;
+  uint8_t level;
+  uint8_t flags;
+};
+
+/// Lives in RTC slow memory, survives deep sleep and is zeroed by any other reset.
+struct AXP202SampleBuffer {
+  uint16_t start;
+  uint16_t count;
+  uint16_t wakes;
+  uint8_t last_level;
+  uint8_t last_flags;
+  AXP202Sample samples[AXP202_SAMPLE_BUFFER_SIZE];
+};
+#endif
+
 class AXP202Component : public PollingComponent, public i2c::I2CDevice {
  public:
   void set_interrupt_pin(InternalGPIOPin *pin) { this->interrupt_pin_ = pin; }
@@ -31,6 +65,25 @@ class AXP202Component : public PollingComponent, public i2c::I2CDevice {
   void set_button_binary_sensor(binary_sensor::BinarySensor *button) { button_ = button; }
   void set_bus_voltage_sensor(sensor::Sensor *bus_voltage_sensor) { bus_voltage_sensor_ = bus_voltage_sensor; }
   void set_brightness(float brightness) { brightness_ = brightness; }
+  void set_charge_current(uint16_t charge_current) { charge_current_ = charge_current; }
+  void set_charge_policy(bool charge_policy) { charge_policy_ = charge_policy; }
+  void set_throttled_current(uint16_t throttled_current) { throttled_current_ = throttled_current; }
+  void set_max_temperature(float max_temperature) { max_temperature_ = max_temperature; }
+  void set_min_ts_voltage(float min_ts_voltage) { min_ts_voltage_ = min_ts_voltage; }
+  void set_temperature_hysteresis(float hysteresis) { temperature_hysteresis_ = hysteresis; }
+  void set_ts_hysteresis(float ts_hysteresis) { ts_hysteresis_ = ts_hysteresis; }
+#ifdef USE_I2C_SCHEDULER
+  void set_scheduler(i2c_scheduler::I2CScheduler *scheduler) { scheduler_ = scheduler; }
+#endif
+#ifdef USE_AXP202_SAMPLE_BUFFER
+  void set_publish_every(uint16_t publish_every) { publish_every_ = publish_every; }
+  void set_level_change(uint8_t level_change) { level_change_ = level_change; }
+  Trigger<> *get_publish_due_trigger() { return &publish_due_trigger_; }
+  Trigger<uint32_t, float, float, uint8_t, float, bool, bool> *get_sample_trigger() { return &sample_trigger_; }
+  Trigger<> *get_published_trigger() { return &published_trigger_; }
+  void set_publish_timeout(uint32_t publish_timeout) { publish_timeout_ = publish_timeout; }
+  Trigger<> *get_publish_failed_trigger() { return &publish_failed_trigger_; }
+#endif
 
   // ========== INTERNAL METHODS ==========
   // (In most use cases you won't need these)
@@ -43,6 +96,10 @@ class AXP202Component : public PollingComponent, public i2c::I2CDevice {
   void SetLDO2(bool State);
   void SetLDO3(bool State);
 
+  /// Change the charge current setpoint at runtime, in mA (300-1800 in steps of 100)
+  void apply_charge_current(uint16_t charge_current);
+  uint16_t get_charge_current() const { return charge_current_; }
+
  protected:
   sensor::Sensor *battery_level_sensor_{nullptr};
   sensor::Sensor *battery_current_sensor_{nullptr};
@@ -55,8 +112,49 @@ class AXP202Component : public PollingComponent, public i2c::I2CDevice {
   float curr_brightness_{-1.0f};
   unsigned int pek_press_{0};
 
+  /* Charge current. Without the policy the setpoint is written as is. With
+   * it the setpoint is used while on USB and cool, and throttled_current
+   * once the PMU die or the battery NTC (TS pin) reads warm.
+   */
+  uint16_t charge_current_{300};
+  uint16_t applied_charge_current_{0};
+  bool charge_policy_{false};
+  bool charge_throttled_{false};
+  uint16_t throttled_current_{300};
+  float max_temperature_{60.0f};
+  float min_ts_voltage_{0.0f};
+  float temperature_hysteresis_{5.0f};
+  float ts_hysteresis_{0.05f};
+
   InternalGPIOPin *interrupt_pin_{nullptr};
   AXP202Store store_;
+#ifdef USE_I2C_SCHEDULER
+  // Telemetry goes out as background work, every register access holds the bus
+  i2c_scheduler::I2CScheduler *scheduler_{nullptr};
+#endif
+#ifdef USE_AXP202_SAMPLE_BUFFER
+  /* Rather than publishing, each update appends to the RTC buffer. The
+   * backlog is only published when publish_every wakes have passed or
+   * something moved enough to be worth bringing the radio up for.
+   */
+  uint16_t publish_every_{10};
+  uint8_t level_change_{5};
+  bool publish_due_{false};
+  bool flush_pending_{false};
+  Trigger<> publish_due_trigger_;
+  // timestamp, battery voltage, battery current, battery level, bus voltage, charging, usb
+  Trigger<uint32_t, float, float, uint8_t, float, bool, bool> sample_trigger_;
+  Trigger<> published_trigger_;
+  uint32_t publish_timeout_{60000};
+  Trigger<> publish_failed_trigger_;
+  // The boot sample, so the first update() of a wake doesn't take a second one
+  bool sampled_{false};
+  uint32_t last_sample_ms_{0};
+
+  void bufferSample();
+  void flushSamples();
+  void publishSample(const AXP202Sample &sample);
+#endif
 
   /**
    * LDO2: Display backlight
@@ -66,6 +164,8 @@ class AXP202Component : public PollingComponent, public i2c::I2CDevice {
    */
   void begin(bool disableLDO2 = false, bool disableLDO3 = false);
   void UpdateBrightness();
+  void publishSensors();
+  void applyChargePolicy();
   void publishCharging();
   void publishUsb();
   bool GetBatState();
@@ -108,6 +208,7 @@ class AXP202Component : public PollingComponent, public i2c::I2CDevice {
   float GetVBusVoltage();
   float GetVBusCurrent();
   float GetTempInternal();
+  float GetTsVoltage();
 
   void SetLDO4(bool State);
 
@@ -0,0 +1,44 @@
+#include "axp202_number.h"
+#include "esphome/core/log.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace esphome {
+namespace axp202 {
+
+static const char *const TAG = "axp202.number";
+
+// REG33H only holds 300mA to 1800mA in 100mA steps, anything else would write stray bits
+static uint16_t snap_charge_current(float value) {
+  return static_cast<uint16_t>(lroundf(std::clamp(value, 300.0f, 1800.0f) / 100.0f) * 100);
+}
+
+void AXP202ChargeCurrentNumber::setup() {
+  float value = this->parent_->get_charge_current();
+  if (this->restore_value_) {
+    this->pref_ = global_preferences->make_preference<float>(this->get_object_id_hash());
+    float restored;
+    if (this->pref_.load(&restored) && std::isfinite(restored)) {
+      uint16_t snapped = snap_charge_current(restored);
+      if (snapped != value) {
+        value = snapped;
+        this->parent_->apply_charge_current(snapped);
+      }
+    }
+  }
+  this->publish_state(value);
+}
+
+void AXP202ChargeCurrentNumber::control(float value) {
+  value = snap_charge_current(value);
+  this->parent_->apply_charge_current(static_cast<uint16_t>(value));
+  if (this->restore_value_)
+    this->pref_.save(&value);
+  this->publish_state(value);
+}
+
+void AXP202ChargeCurrentNumber::dump_config() { LOG_NUMBER("", "AXP202 Charge Current", this); }
+
+}  // namespace axp202
+}  // namespace esphome
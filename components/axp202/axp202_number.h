@@ -0,0 +1,29 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/number/number.h"
+#include "axp202.h"
+
+namespace esphome {
+namespace axp202 {
+
+class AXP202ChargeCurrentNumber : public number::Number, public Component, public Parented<AXP202Component> {
+ public:
+  void setup() override;
+  void dump_config() override;
+  // After the PMU itself is configured
+  float get_setup_priority() const override { return setup_priority::DATA - 1.0f; }
+
+  void set_restore_value(bool restore_value) { this->restore_value_ = restore_value; }
+
+ protected:
+  void control(float value) override;
+
+  bool restore_value_{true};
+  ESPPreferenceObject pref_;
+};
+
+}  // namespace axp202
+}  // namespace esphome
@@ -0,0 +1,49 @@
+import esphome.codegen as cg
+from esphome.components import number
+import esphome.config_validation as cv
+from esphome.const import (
+    CONF_RESTORE_VALUE,
+    DEVICE_CLASS_CURRENT,
+    ENTITY_CATEGORY_CONFIG,
+    UNIT_MILLIAMP,
+)
+
+from . import CONF_AXP202_ID, CONF_CHARGE_CURRENT, AXP202Component, axp202_ns
+
+AXP202ChargeCurrentNumber = axp202_ns.class_(
+    "AXP202ChargeCurrentNumber",
+    number.Number,
+    cg.Component,
+    cg.Parented.template(AXP202Component),
+)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_AXP202_ID): cv.use_id(AXP202Component),
+        cv.Optional(CONF_CHARGE_CURRENT): number.number_schema(
+            AXP202ChargeCurrentNumber,
+            unit_of_measurement=UNIT_MILLIAMP,
+            device_class=DEVICE_CLASS_CURRENT,
+            entity_category=ENTITY_CATEGORY_CONFIG,
+            icon="mdi:battery-charging",
+        )
+        .extend(
+            {
+                cv.Optional(CONF_RESTORE_VALUE, default=True): cv.boolean,
+            }
+        )
+        .extend(cv.COMPONENT_SCHEMA),
+    }
+)
+
+
+async def to_code(config):
+    parent = await cg.get_variable(config[CONF_AXP202_ID])
+
+    if charge_current_config := config.get(CONF_CHARGE_CURRENT):
+        var = await number.new_number(
+            charge_current_config, min_value=300, max_value=1800, step=100
+        )
+        await cg.register_component(var, charge_current_config)
+        await cg.register_parented(var, parent)
+        cg.add(var.set_restore_value(charge_current_config[CONF_RESTORE_VALUE]))
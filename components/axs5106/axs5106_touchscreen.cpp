@@ -1,10 +1,23 @@
 #include "axs5106_touchscreen.h"
 
+#include <cinttypes>
+#include <cmath>
+
+#ifdef USE_EVENT_TRACE
+#include "esphome/components/event_trace/event_trace.h"
+#endif
+
 namespace esphome {
 namespace axs5106 {
 
 static const char *const TAG = "axs5106.touchscreen";
 
+#ifdef USE_EVENT_TRACE
+#define AXS5106_TRACE(event, arg0, arg1) event_trace::record(event_trace::event, arg0, arg1)
+#else
+#define AXS5106_TRACE(event, arg0, arg1)
+#endif
+
 const uint8_t TOUCH_AXS5106_TOUCH_POINTS_REG = 0x01;
 const uint8_t TOUCH_AXS5106_TOUCH_ID_REG = 0x08;
 
@@ -36,14 +49,100 @@ void AXS5106Touchscreen::setup() {
   this->reset_pin_->digital_write(true);
   delay(10);
 
+  // The configured transform, folded into the matrix if affine calibration is in use
+  this->fold_swap_ = this->swap_x_y_;
+  this->fold_invert_x_ = this->invert_x_;
+  this->fold_invert_y_ = this->invert_y_;
+  this->fold_raw_[0] = this->x_raw_min_;
+  this->fold_raw_[1] = this->x_raw_max_;
+  this->fold_raw_[2] = this->y_raw_min_;
+  this->fold_raw_[3] = this->y_raw_max_;
+  this->calibration_pref_ = global_preferences->make_preference<AffineCalibration>(this->calibration_key_);
+  AffineCalibration saved;
+  bool have_saved = this->calibration_pref_.load(&saved) && this->calibration_valid_(saved);
+  if (have_saved && !this->restore_calibration_) {
+    // restore: false, or no affine_calibration block at all, must not leave a stale matrix behind
+    this->erase_calibration_();
+    have_saved = false;
+  }
+  if (have_saved) {
+    ESP_LOGD(TAG, "Restored affine calibration");
+    this->apply_calibration_(saved);
+  } else if (this->has_calibration_) {
+    this->apply_calibration_(this->calibration_);
+  }
+
   if (this->interrupt_pin_ != nullptr) {
     this->interrupt_pin_->pin_mode(gpio::FLAG_INPUT | gpio::FLAG_PULLUP);
     this->interrupt_pin_->setup();
+#ifdef USE_ESP32
+    if (this->acquisition_task_ && this->start_acquisition_task_())
+      return;
+#endif
     this->attach_interrupt_(this->interrupt_pin_, gpio::INTERRUPT_FALLING_EDGE);
   }
 }
 
-void AXS5106Touchscreen::update_touches() {
+#ifdef USE_ESP32
+/* Above the main loop (1) and lwIP (18) so neither a display flush nor
+ * API traffic can hold off a touch read, but below the Wi-Fi driver.
+ */
+static const UBaseType_t ACQUISITION_TASK_PRIORITY = 19;
+static const uint32_t ACQUISITION_TASK_STACK = 3072;
+
+bool AXS5106Touchscreen::start_acquisition_task_() {
+  if (xTaskCreate(AXS5106Touchscreen::acquisition_loop, "axs5106", ACQUISITION_TASK_STACK, this,
+                  ACQUISITION_TASK_PRIORITY, &this->task_handle_) != pdPASS) {
+    ESP_LOGW(TAG, "Could not start acquisition task, reading from the main loop");
+    this->task_handle_ = nullptr;
+    return false;
+  }
+
+  // Mirror attach_interrupt_(), the base class must not poll or read on its own
+  this->store_.init = true;
+  this->store_.touched = false;
+  this->interrupt_pin_->attach_interrupt(AXS5106Touchscreen::gpio_intr, this, gpio::INTERRUPT_FALLING_EDGE);
+  return true;
+}
+
+void IRAM_ATTR AXS5106Touchscreen::gpio_intr(AXS5106Touchscreen *arg) {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(arg->task_handle_, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void AXS5106Touchscreen::acquisition_loop(void *arg) {
+  auto *self = static_cast<AXS5106Touchscreen *>(arg);
+  TouchFrame frame;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (!self->read_frame_(frame)) {
+      self->read_failed_.store(true);
+    } else if (self->release_pending_.load()) {
+      // Nothing may overtake a release still waiting for room
+    } else if (!self->frames_.push(frame) && frame.count == 0) {
+      // Main loop is more than a queue behind. Moves are stale by now, but the release must be seen
+      self->release_pending_.store(true);
+    }
+    // Never store_.touched, the base class clears that after update_touches() and would lose the wakeup
+    self->frames_pending_.store(true);
+  }
+}
+
+bool AXS5106Touchscreen::pop_frame_(TouchFrame &frame) {
+  if (this->frames_.pop(frame))
+    return true;
+  // The task stops queueing while this is set, so the release really is the latest frame
+  if (!this->release_pending_.exchange(false))
+    return false;
+  frame = TouchFrame{};
+  return true;
+}
+#endif
+
+bool AXS5106Touchscreen::read_frame_(TouchFrame &frame) {
   uint8_t data[14] = {0};  // copying byte read size in case it's fixed
 
   /* This bit is a little stupid.  You can't use `read_register` here
@@ -53,45 +152,416 @@ void AXS5106Touchscreen::update_touches() {
    * The datasheet for the CST5106L says to wait 45us and then you'll
    * still get a NACK
    */
-  i2c::ErrorCode err = this->write(&TOUCH_AXS5106_TOUCH_POINTS_REG, 1);
-  if (err != i2c::ERROR_OK) {
-    this->status_set_warning(ESP_LOG_MSG_COMM_FAIL);
-    this->skip_update_ = true;
-    ESP_LOGE(TAG, "Read failed");
-    return;
+  {
+#ifdef USE_I2C_SCHEDULER
+    i2c_scheduler::BusLock bus_lock(this->scheduler_, i2c_scheduler::PRIORITY_CRITICAL);
+#endif
+    if (this->write(&TOUCH_AXS5106_TOUCH_POINTS_REG, 1) != i2c::ERROR_OK) {
+      AXS5106_TRACE(AXS5106_READ_FAILED, 0, 0);
+      return false;
+    }
+    delayMicroseconds(45);
+    this->read_bytes_raw(data, 14);
   }
-  delayMicroseconds(45);
-  this->read_bytes_raw(data, 14);
-
-  this->status_clear_warning();
 
   for (int i = 0; i < 14; i++) {
     ESP_LOGVV(TAG, "  reg[%d]=%02x", i + 1, data[i]);
   }
 
   // I don't think this even supports two touches, can't see them
-  uint8_t num_touches = data[1] & 0xf;
-  if (num_touches > 2) {
-    ESP_LOGV(TAG, "Limiting number of touches from %u to 2", num_touches);
-    num_touches = 2;
+  frame.count = data[1] & 0xf;
+  if (frame.count > AXS5106_MAX_TOUCHES) {
+    ESP_LOGV(TAG, "Limiting number of touches from %u to %u", frame.count, AXS5106_MAX_TOUCHES);
+    frame.count = AXS5106_MAX_TOUCHES;
   }
 
-  // num_touches can be zero to indicate end of gesture
+  // count can be zero to indicate end of gesture
 
-  for (int i = 0; i < num_touches; i++) {
+  for (int i = 0; i < frame.count; i++) {
     int idx = 2 + (6 * i);
-    int16_t x = ((data[idx] & 0xf) << 8) | data[idx + 1];
-    int16_t y = ((data[idx + 2] & 0xf) << 8) | data[idx + 3];
-    this->add_raw_touch_position_(i, x, y);
-    ESP_LOGD(TAG, "Read touch %d: x:%d y:%d", i, x, y);
+    frame.x[i] = ((data[idx] & 0xf) << 8) | data[idx + 1];
+    frame.y[i] = ((data[idx + 2] & 0xf) << 8) | data[idx + 3];
+    AXS5106_TRACE(AXS5106_TOUCH, frame.x[i], (i << 16) | frame.y[i]);
+  }
+  if (frame.count == 0) {
+    AXS5106_TRACE(AXS5106_RELEASE, 0, 0);
+  }
+  return true;
+}
+
+void AXS5106Touchscreen::report_frame_(const TouchFrame &frame) {
+  if (this->wake_swallow_) {
+    this->wake_swallow_ = frame.count != 0;
+    return;
+  }
+  for (int i = 0; i < frame.count; i++) {
+    if (this->affine_active_) {
+      int32_t x = this->apply_row_(&this->matrix_[0], frame.x[i], frame.y[i], this->display_width_);
+      int32_t y = this->apply_row_(&this->matrix_[3], frame.x[i], frame.y[i], this->display_height_);
+      // Centre of the pixel, so the base class's scaling lands back on it exactly
+      this->add_raw_touch_position_(i, x * CALIBRATION_SUBPIXELS + CALIBRATION_SUBPIXELS / 2,
+                                    y * CALIBRATION_SUBPIXELS + CALIBRATION_SUBPIXELS / 2);
+      ESP_LOGV(TAG, "Read touch %d: x:%d y:%d -> %" PRId32 ",%" PRId32, i, frame.x[i], frame.y[i], x, y);
+      continue;
+    }
+    this->add_raw_touch_position_(i, frame.x[i], frame.y[i]);
+    ESP_LOGV(TAG, "Read touch %d: x:%d y:%d", i, frame.x[i], frame.y[i]);
   }
 }
 
+void AXS5106Touchscreen::loop() {
+#ifdef USE_ESP32
+  // Cleared before draining, so a frame queued meanwhile leaves it set for the next pass
+  if (this->task_handle_ != nullptr && this->frames_pending_.exchange(false))
+    this->store_.touched = true;
+#endif
+
+  // Modes that take touches away from the framework start once it has seen the current gesture released
+  if (!this->is_touched_) {
+    if (this->screen_off_pending_) {
+      this->screen_off_pending_ = false;
+      this->screen_off_ = true;
+      this->wake_touching_ = false;
+      this->wake_taps_ = 0;
+      ESP_LOGD(TAG, "Screen off, waiting for wake pattern");
+    }
+    if (this->calibration_pending_) {
+      this->calibration_pending_ = false;
+      this->calibrating_ = true;
+      this->calibration_index_ = 0;
+      this->calibration_sum_x_ = this->calibration_sum_y_ = this->calibration_samples_ = 0;
+      ESP_LOGD(TAG, "Calibrating with %u points", (unsigned) this->calibration_targets_.size());
+      this->calibration_point_trigger_.trigger(0, this->calibration_targets_[0].first,
+                                               this->calibration_targets_[0].second);
+    }
+  }
+
+  if (!this->intercepting_()) {
+    touchscreen::Touchscreen::loop();
+    return;
+  }
+
+  // Frames still have to be read to clear the interrupt, but go no further than the driver
+  if (!this->store_.touched)
+    return;
+  this->store_.touched = false;
+
+#ifdef USE_ESP32
+  if (this->task_handle_ != nullptr) {
+    while (this->intercepting_() && this->pop_frame_(this->last_frame_))
+      this->intercept_frame_(this->last_frame_);
+    if (this->frames_waiting_())
+      this->frames_pending_.store(true);
+    return;
+  }
+#endif
+
+  TouchFrame frame;
+  if (!this->read_frame_(frame)) {
+    this->status_set_warning(ESP_LOG_MSG_COMM_FAIL);
+    return;
+  }
+  this->status_clear_warning();
+  this->intercept_frame_(frame);
+}
+
+void AXS5106Touchscreen::intercept_frame_(const TouchFrame &frame) {
+  if (this->calibrating_) {
+    this->handle_calibration_frame_(frame);
+  } else {
+    this->handle_wake_frame_(frame);
+  }
+}
+
+void AXS5106Touchscreen::set_affine_calibration(float a, float b, float c, float d, float e, float f) {
+  this->calibration_ = AffineCalibration{{a, b, c, d, e, f}};
+  this->has_calibration_ = true;
+}
+
+void AXS5106Touchscreen::start_calibration(const std::vector<std::pair<int16_t, int16_t>> &targets) {
+  if (targets.size() < 3) {
+    ESP_LOGW(TAG, "Calibration needs at least 3 points");
+    return;
+  }
+  this->calibration_targets_ = targets;
+  this->calibration_raw_.clear();
+  this->calibrating_ = false;
+  this->calibration_pending_ = true;
+}
+
+void AXS5106Touchscreen::handle_calibration_frame_(const TouchFrame &frame) {
+  // Average the whole press, the first frames of a touch are the least settled
+  if (frame.count > 0) {
+    this->calibration_sum_x_ += frame.x[0];
+    this->calibration_sum_y_ += frame.y[0];
+    this->calibration_samples_++;
+    return;
+  }
+  if (this->calibration_samples_ == 0)
+    return;
+
+  this->calibration_raw_.emplace_back(this->calibration_sum_x_ / (float) this->calibration_samples_,
+                                      this->calibration_sum_y_ / (float) this->calibration_samples_);
+  ESP_LOGV(TAG, "Calibration point %u: raw x:%.1f y:%.1f", this->calibration_index_,
+           this->calibration_raw_.back().first, this->calibration_raw_.back().second);
+  this->calibration_sum_x_ = this->calibration_sum_y_ = this->calibration_samples_ = 0;
+  this->calibration_index_++;
+
+  if (this->calibration_index_ < this->calibration_targets_.size()) {
+    const auto &target = this->calibration_targets_[this->calibration_index_];
+    this->calibration_point_trigger_.trigger(this->calibration_index_, target.first, target.second);
+    return;
+  }
+
+  this->calibrating_ = false;
+  AffineCalibration native;
+  bool ok = this->solve_calibration_(native);
+  if (!ok) {
+    ESP_LOGW(TAG, "Calibration failed, points are too close to a line");
+  } else if ((ok = this->apply_calibration_(native))) {
+    this->calibration_pref_.save(&native);
+    global_preferences->sync();
+    ESP_LOGI(TAG, "Calibration saved");
+  }
+  this->calibration_done_trigger_.trigger(ok);
+}
+
+void AXS5106Touchscreen::erase_calibration_() {
+  // Preferences can't be deleted, a non finite matrix reads back as none
+  AffineCalibration cleared;
+  std::fill(std::begin(cleared.m), std::end(cleared.m), NAN);
+  this->calibration_pref_.save(&cleared);
+  global_preferences->sync();
+}
+
+void AXS5106Touchscreen::reset_calibration() {
+  this->calibration_pending_ = false;
+  this->calibrating_ = false;
+  this->erase_calibration_();
+  if (this->has_calibration_ && this->apply_calibration_(this->calibration_)) {
+    ESP_LOGI(TAG, "Calibration reset to the configured coefficients");
+    return;
+  }
+
+  this->affine_active_ = false;
+  this->swap_x_y_ = this->fold_swap_;
+  this->invert_x_ = this->fold_invert_x_;
+  this->invert_y_ = this->fold_invert_y_;
+  this->set_calibration(this->fold_raw_[0], this->fold_raw_[1], this->fold_raw_[2], this->fold_raw_[3]);
+  ESP_LOGI(TAG, "Calibration reset");
+}
+
+/* Least squares fit of native = M * [raw_x raw_y 1], exact for three points.
+ * The targets are in reported coordinates, so the configured transform is
+ * undone first and the result stays valid if the transform is changed.
+ */
+bool AXS5106Touchscreen::solve_calibration_(AffineCalibration &out) {
+  int16_t width = this->fold_swap_ ? this->display_height_ : this->display_width_;
+  int16_t height = this->fold_swap_ ? this->display_width_ : this->display_height_;
+
+  // Normal equations, A^T A is shared by both rows
+  double ata[3][3] = {};
+  double atu[3] = {}, atv[3] = {};
+  for (size_t i = 0; i < this->calibration_raw_.size(); i++) {
+    double row[3] = {this->calibration_raw_[i].first, this->calibration_raw_[i].second, 1.0};
+    double u = this->calibration_targets_[i].first;
+    double v = this->calibration_targets_[i].second;
+    if (this->fold_swap_)
+      std::swap(u, v);
+    if (this->fold_invert_x_)
+      u = width - 1 - u;
+    if (this->fold_invert_y_)
+      v = height - 1 - v;
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++)
+        ata[r][c] += row[r] * row[c];
+      atu[r] += row[r] * u;
+      atv[r] += row[r] * v;
+    }
+  }
+
+  // Cramer's rule, it is only ever 3x3
+  auto det3 = [](const double m[3][3]) {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  };
+  double det = det3(ata);
+  if (fabs(det) < 1e-4 * ata[0][0] * ata[1][1] * ata[2][2])
+    return false;
+
+  for (int col = 0; col < 3; col++) {
+    double mu[3][3], mv[3][3];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        mu[r][c] = c == col ? atu[r] : ata[r][c];
+        mv[r][c] = c == col ? atv[r] : ata[r][c];
+      }
+    }
+    out.m[col] = det3(mu) / det;
+    out.m[3 + col] = det3(mv) / det;
+  }
+  return true;
+}
+
+/* Fold the configured mirroring and swap into the native matrix and hand
+ * the base class an identity transform, so reporting a point is two
+ * fixed point dot products.
+ */
+bool AXS5106Touchscreen::apply_calibration_(const AffineCalibration &native) {
+  if (this->display_width_ == 0 || this->display_height_ == 0) {
+    ESP_LOGW(TAG, "Affine calibration needs a display, ignoring it");
+    return false;
+  }
+
+  int16_t width = this->fold_swap_ ? this->display_height_ : this->display_width_;
+  int16_t height = this->fold_swap_ ? this->display_width_ : this->display_height_;
+
+  float u[3] = {native.m[0], native.m[1], native.m[2]};
+  float v[3] = {native.m[3], native.m[4], native.m[5]};
+  if (this->fold_invert_x_) {
+    u[0] = -u[0];
+    u[1] = -u[1];
+    u[2] = width - 1 - u[2];
+  }
+  if (this->fold_invert_y_) {
+    v[0] = -v[0];
+    v[1] = -v[1];
+    v[2] = height - 1 - v[2];
+  }
+  const float *x = this->fold_swap_ ? v : u;
+  const float *y = this->fold_swap_ ? u : v;
+  for (int i = 0; i < 3; i++) {
+    this->matrix_[i] = lroundf(x[i] * (1 << CALIBRATION_FRACTION_BITS));
+    this->matrix_[3 + i] = lroundf(y[i] * (1 << CALIBRATION_FRACTION_BITS));
+  }
+
+  this->swap_x_y_ = false;
+  this->invert_x_ = false;
+  this->invert_y_ = false;
+  this->set_calibration(0, this->display_width_ * CALIBRATION_SUBPIXELS, 0,
+                        this->display_height_ * CALIBRATION_SUBPIXELS);
+  this->affine_active_ = true;
+  return true;
+}
+
+void AXS5106Touchscreen::set_screen_off(bool screen_off) {
+  if (!screen_off) {
+    this->screen_off_pending_ = false;
+    this->screen_off_ = false;
+    this->cancel_timeout("wake_hold");
+    return;
+  }
+  // Applied from loop() once the framework has seen the current gesture released
+  this->screen_off_pending_ = !this->screen_off_;
+}
+
+bool AXS5106Touchscreen::in_wake_region_(int16_t x, int16_t y) const {
+  if (this->wake_regions_.empty())
+    return true;
+  for (const auto &region : this->wake_regions_) {
+    if (x >= region.x_min && x <= region.x_max && y >= region.y_min && y <= region.y_max)
+      return true;
+  }
+  return false;
+}
+
+void AXS5106Touchscreen::handle_wake_frame_(const TouchFrame &frame) {
+  uint32_t now = millis();
+  bool final_tap = this->wake_taps_ + 1 >= this->wake_tap_count_;
+
+  if (frame.count > 0) {
+    // Only the touch down position counts, later frames are the same finger
+    if (this->wake_touching_)
+      return;
+    this->wake_touching_ = true;
+    this->wake_press_valid_ = this->in_wake_region_(frame.x[0], frame.y[0]);
+    if (this->wake_taps_ > 0 && now - this->wake_last_release_ > this->wake_tap_gap_)
+      this->wake_taps_ = 0;
+    final_tap = this->wake_taps_ + 1 >= this->wake_tap_count_;
+
+    if (this->wake_press_valid_ && final_tap && this->wake_hold_time_ > 0) {
+      this->set_timeout("wake_hold", this->wake_hold_time_, [this]() {
+        if (this->screen_off_ && this->wake_touching_)
+          this->wake_(true);
+      });
+    }
+    return;
+  }
+
+  if (!this->wake_touching_)
+    return;
+  this->wake_touching_ = false;
+  this->wake_last_release_ = now;
+
+  if (!this->wake_press_valid_ || (final_tap && this->wake_hold_time_ > 0)) {
+    // Outside every region, or let go before the hold completed
+    this->cancel_timeout("wake_hold");
+    this->wake_taps_ = 0;
+    return;
+  }
+
+  this->wake_taps_++;
+  if (this->wake_taps_ >= this->wake_tap_count_)
+    this->wake_(false);
+}
+
+void AXS5106Touchscreen::wake_(bool held) {
+  ESP_LOGD(TAG, "Wake pattern matched");
+  this->screen_off_ = false;
+  this->wake_taps_ = 0;
+  this->wake_swallow_ = held;
+  this->wake_trigger_.trigger();
+}
+
+void AXS5106Touchscreen::update_touches() {
+  TouchFrame frame;
+
+#ifdef USE_ESP32
+  if (this->task_handle_ != nullptr) {
+    if (this->read_failed_.exchange(false)) {
+      this->status_set_warning(ESP_LOG_MSG_COMM_FAIL);
+    } else {
+      this->status_clear_warning();
+    }
+
+    /* Only the latest position of a gesture matters, but a release must
+     * always be seen so stop draining at one and come back for the rest.
+     * Nothing queued means nothing changed since the last frame.
+     */
+    while (this->pop_frame_(this->last_frame_)) {
+      if (this->last_frame_.count == 0)
+        break;
+    }
+    if (this->frames_waiting_())
+      this->frames_pending_.store(true);
+
+    this->report_frame_(this->last_frame_);
+    return;
+  }
+#endif
+
+  if (!this->read_frame_(frame)) {
+    this->status_set_warning(ESP_LOG_MSG_COMM_FAIL);
+    this->skip_update_ = true;
+    ESP_LOGE(TAG, "Read failed");
+    return;
+  }
+
+  this->status_clear_warning();
+  this->report_frame_(frame);
+}
+
 void AXS5106Touchscreen::dump_config() {
   ESP_LOGCONFIG(TAG, "AXS5106 Touchscreen:");
   LOG_I2C_DEVICE(this);
   LOG_PIN("  Interrupt Pin: ", this->interrupt_pin_);
   LOG_PIN("  Reset Pin: ", this->reset_pin_);
+  ESP_LOGCONFIG(TAG, "  Affine Calibration: %s", YESNO(this->affine_active_));
+  ESP_LOGCONFIG(TAG, "  Wake Pattern: %u tap(s), %" PRIu32 "ms hold, %u region(s)", this->wake_tap_count_,
+                this->wake_hold_time_, (unsigned) this->wake_regions_.size());
+#ifdef USE_ESP32
+  ESP_LOGCONFIG(TAG, "  Acquisition Task: %s", YESNO(this->task_handle_ != nullptr));
+#endif
   LOG_UPDATE_INTERVAL(this);
 }
 
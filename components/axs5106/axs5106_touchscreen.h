@@ -2,24 +2,252 @@
 
 #include "esphome/components/i2c/i2c.h"
 #include "esphome/components/touchscreen/touchscreen.h"
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#ifdef USE_I2C_SCHEDULER
+#include "esphome/components/i2c_scheduler/i2c_scheduler.h"
+#endif
+
+#ifdef USE_ESP32
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace esphome {
 namespace axs5106 {
 
+static const uint8_t AXS5106_MAX_TOUCHES = 2;
+
+/// One decoded report from the controller, zero touches marks the end of a gesture.
+struct TouchFrame {
+  uint8_t count{0};
+  int16_t x[AXS5106_MAX_TOUCHES]{};
+  int16_t y[AXS5106_MAX_TOUCHES]{};
+};
+
+// Fixed point fraction of the calibration matrix
+static const int CALIBRATION_FRACTION_BITS = 16;
+// Points are handed to the base class in sub-pixels so its rescaling is exact
+static const int16_t CALIBRATION_SUBPIXELS = 8;
+
+/// Raw coordinates to native panel pixels, x = m0*rx + m1*ry + m2 and y = m3*rx + m4*ry + m5.
+struct AffineCalibration {
+  float m[6];
+};
+
+/// Area of the panel in raw controller coordinates that can wake the screen.
+struct WakeRegion {
+  int16_t x_min;
+  int16_t x_max;
+  int16_t y_min;
+  int16_t y_max;
+};
+
+#ifdef USE_ESP32
+/// Lock-free ring for exactly one producer and one consumer. SIZE must be a power of two.
+template<typename T, uint8_t SIZE> class SPSCQueue {
+  static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+ public:
+  bool push(const T &item) {
+    uint8_t head = this->head_.load(std::memory_order_relaxed);
+    if (static_cast<uint8_t>(head - this->tail_.load(std::memory_order_acquire)) == SIZE)
+      return false;
+    this->items_[head & (SIZE - 1)] = item;
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item) {
+    uint8_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail == this->head_.load(std::memory_order_acquire))
+      return false;
+    item = this->items_[tail & (SIZE - 1)];
+    this->tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return this->tail_.load(std::memory_order_relaxed) == this->head_.load(std::memory_order_acquire);
+  }
+
+ protected:
+  T items_[SIZE];
+  std::atomic<uint8_t> head_{0};
+  std::atomic<uint8_t> tail_{0};
+};
+#endif
+
 class AXS5106Touchscreen : public touchscreen::Touchscreen, public i2c::I2CDevice {
  public:
   void setup() override;
+  void loop() override;
   void update_touches() override;
   void dump_config() override;
 
   void set_interrupt_pin(InternalGPIOPin *pin) { this->interrupt_pin_ = pin; }
   void set_reset_pin(GPIOPin *pin) { this->reset_pin_ = pin; }
+  void set_acquisition_task(bool acquisition_task) { this->acquisition_task_ = acquisition_task; }
+#ifdef USE_I2C_SCHEDULER
+  void set_scheduler(i2c_scheduler::I2CScheduler *scheduler) { this->scheduler_ = scheduler; }
+#endif
+  void add_wake_region(int16_t x_min, int16_t x_max, int16_t y_min, int16_t y_max) {
+    this->wake_regions_.push_back(WakeRegion{x_min, x_max, y_min, y_max});
+  }
+  void set_wake_tap_count(uint8_t tap_count) { this->wake_tap_count_ = tap_count; }
+  void set_wake_tap_gap(uint32_t tap_gap) { this->wake_tap_gap_ = tap_gap; }
+  void set_wake_hold_time(uint32_t hold_time) { this->wake_hold_time_ = hold_time; }
+  Trigger<> *get_wake_trigger() { return &this->wake_trigger_; }
+
+  void set_affine_calibration(float a, float b, float c, float d, float e, float f);
+  void set_restore_calibration(bool restore) { this->restore_calibration_ = restore; }
+  /// Per instance, so two touchscreens don't share one saved matrix.
+  void set_calibration_key(const std::string &id) { this->calibration_key_ = fnv1_hash("axs5106_calibration_" + id); }
+  Trigger<uint8_t, int16_t, int16_t> *get_calibration_point_trigger() { return &this->calibration_point_trigger_; }
+  Trigger<bool> *get_calibration_done_trigger() { return &this->calibration_done_trigger_; }
+
+  /// Ask for a touch on each target in turn (reported coordinates), then fit, persist and apply the matrix.
+  void start_calibration(const std::vector<std::pair<int16_t, int16_t>> &targets);
+  /// Forget the saved matrix and go back to the configured coefficients, or the plain min/max calibration.
+  void reset_calibration();
+
+  /// While the screen is off touches only feed the wake pattern. Turning it off waits for the current gesture to end.
+  void set_screen_off(bool screen_off);
+  bool is_screen_off() const { return this->screen_off_; }
 
   InternalGPIOPin *interrupt_pin_{};
   GPIOPin *reset_pin_{};
+
+ protected:
+  bool read_frame_(TouchFrame &frame);
+  void report_frame_(const TouchFrame &frame);
+
+  void handle_wake_frame_(const TouchFrame &frame);
+  bool in_wake_region_(int16_t x, int16_t y) const;
+  void wake_(bool held);
+  bool intercepting_() const { return this->screen_off_ || this->calibrating_; }
+  void intercept_frame_(const TouchFrame &frame);
+  void handle_calibration_frame_(const TouchFrame &frame);
+  bool solve_calibration_(AffineCalibration &out);
+  bool apply_calibration_(const AffineCalibration &native);
+  void erase_calibration_();
+  static bool calibration_valid_(const AffineCalibration &calibration) {
+    return std::all_of(std::begin(calibration.m), std::end(calibration.m), [](float m) { return std::isfinite(m); });
+  }
+
+  static int32_t apply_row_(const int32_t *row, int16_t x, int16_t y, int16_t limit) {
+    int64_t acc = (int64_t) row[0] * x + (int64_t) row[1] * y + row[2] + (1 << (CALIBRATION_FRACTION_BITS - 1));
+    return std::clamp<int32_t>(acc >> CALIBRATION_FRACTION_BITS, 0, limit - 1);
+  }
+
+  bool acquisition_task_{false};
+
+  /* Screen off mode. A pattern of tap_count taps inside a wake region, the
+   * last one held for hold_time if set, fires the wake trigger and turns
+   * the screen back on. Nothing reaches the touchscreen framework meanwhile.
+   */
+  std::vector<WakeRegion> wake_regions_;
+  uint8_t wake_tap_count_{2};
+  uint32_t wake_tap_gap_{400};
+  uint32_t wake_hold_time_{0};
+  Trigger<> wake_trigger_;
+  bool screen_off_{false};
+  bool screen_off_pending_{false};
+  bool wake_touching_{false};
+  bool wake_press_valid_{false};
+  // Set when woken mid-press, the rest of that gesture is dropped
+  bool wake_swallow_{false};
+  uint8_t wake_taps_{0};
+  uint32_t wake_last_release_{0};
+
+  /* Affine calibration. matrix_ is the native matrix with the configured
+   * transform folded in, in fixed point. The transform and min/max
+   * calibration it replaced are kept so a new calibration can be folded the
+   * same way, and a reset can put them back.
+   */
+  AffineCalibration calibration_{};
+  bool has_calibration_{false};
+  bool restore_calibration_{false};
+  bool affine_active_{false};
+  bool fold_swap_{false};
+  bool fold_invert_x_{false};
+  bool fold_invert_y_{false};
+  int16_t fold_raw_[4]{};
+  int32_t matrix_[6]{};
+  uint32_t calibration_key_{0};
+  ESPPreferenceObject calibration_pref_;
+  Trigger<uint8_t, int16_t, int16_t> calibration_point_trigger_;
+  Trigger<bool> calibration_done_trigger_;
+  bool calibration_pending_{false};
+  bool calibrating_{false};
+  uint8_t calibration_index_{0};
+  int32_t calibration_sum_x_{0};
+  int32_t calibration_sum_y_{0};
+  uint32_t calibration_samples_{0};
+  std::vector<std::pair<int16_t, int16_t>> calibration_targets_;
+  std::vector<std::pair<float, float>> calibration_raw_;
+#ifdef USE_I2C_SCHEDULER
+  // Touch reads are latency critical, they hold background bus work off
+  i2c_scheduler::I2CScheduler *scheduler_{nullptr};
+#endif
+
+#ifdef USE_ESP32
+  /* In task mode the interrupt wakes a dedicated task which does the I2C
+   * transaction and queues the result, so the main loop only ever copies
+   * frames out of memory.
+   */
+  bool start_acquisition_task_();
+  static void gpio_intr(AXS5106Touchscreen *arg);
+  static void acquisition_loop(void *arg);
+  bool pop_frame_(TouchFrame &frame);
+  bool frames_waiting_() const { return !this->frames_.empty() || this->release_pending_.load(); }
+
+  TaskHandle_t task_handle_{nullptr};
+  SPSCQueue<TouchFrame, 16> frames_;
+  TouchFrame last_frame_;
+  std::atomic<bool> read_failed_{false};
+  // Set by the task after queueing, cleared by the main loop before draining
+  std::atomic<bool> frames_pending_{false};
+  // A release that found the queue full, delivered once everything before it has been
+  std::atomic<bool> release_pending_{false};
+#endif
+};
+
+template<typename... Ts> class ScreenOffAction : public Action<Ts...>, public Parented<AXS5106Touchscreen> {
+ public:
+  void play(const Ts &...x) override { this->parent_->set_screen_off(true); }
+};
+
+template<typename... Ts> class ScreenOnAction : public Action<Ts...>, public Parented<AXS5106Touchscreen> {
+ public:
+  void play(const Ts &...x) override { this->parent_->set_screen_off(false); }
+};
+
+template<typename... Ts> class ResetCalibrationAction : public Action<Ts...>, public Parented<AXS5106Touchscreen> {
+ public:
+  void play(const Ts &...x) override { this->parent_->reset_calibration(); }
+};
+
+template<typename... Ts> class CalibrateAction : public Action<Ts...>, public Parented<AXS5106Touchscreen> {
+ public:
+  void add_target(int16_t x, int16_t y) { this->targets_.emplace_back(x, y); }
+  void play(const Ts &...x) override { this->parent_->start_calibration(this->targets_); }
+
+ protected:
+  std::vector<std::pair<int16_t, int16_t>> targets_;
 };
 
 }  // namespace axs5106
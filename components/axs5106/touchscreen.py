@@ -1,15 +1,20 @@
 import logging
 
-from esphome import pins
+from esphome import automation, pins
 import esphome.codegen as cg
 import esphome.config_validation as cv
+import esphome.final_validate as fv
 from esphome.components import i2c, touchscreen
+from esphome.components.i2c_scheduler import CONF_I2C_SCHEDULER_ID, I2CScheduler
 
 from esphome.const import (
     CONF_INTERRUPT_PIN,
     CONF_ID,
     CONF_RESET_PIN,
+    CONF_X,
+    CONF_Y,
 )
+from esphome.core import CORE
 
 LOGGER = logging.getLogger(__name__)
 
@@ -22,25 +27,238 @@ AXS5106Component = axs5106_ns.class_(
     "AXS5106Touchscreen", touchscreen.Touchscreen, i2c.I2CDevice
 )
 
-CONFIG_SCHEMA = (
+CONF_ACQUISITION_TASK = "acquisition_task"
+CONF_WAKE = "wake"
+CONF_REGIONS = "regions"
+CONF_TAP_COUNT = "tap_count"
+CONF_TAP_GAP = "tap_gap"
+CONF_HOLD_TIME = "hold_time"
+CONF_ON_WAKE = "on_wake"
+CONF_AFFINE_CALIBRATION = "affine_calibration"
+CONF_COEFFICIENTS = "coefficients"
+CONF_RESTORE = "restore"
+CONF_ON_POINT = "on_point"
+CONF_ON_DONE = "on_done"
+CONF_POINTS = "points"
+CONF_X_MIN = "x_min"
+CONF_X_MAX = "x_max"
+CONF_Y_MIN = "y_min"
+CONF_Y_MAX = "y_max"
+
+ScreenOffAction = axs5106_ns.class_("ScreenOffAction", automation.Action)
+ScreenOnAction = axs5106_ns.class_("ScreenOnAction", automation.Action)
+CalibrateAction = axs5106_ns.class_("CalibrateAction", automation.Action)
+ResetCalibrationAction = axs5106_ns.class_(
+    "ResetCalibrationAction", automation.Action
+)
+
+
+def _validate_wake_region(config):
+    if config[CONF_X_MIN] >= config[CONF_X_MAX]:
+        raise cv.Invalid(f"{CONF_X_MIN} must be less than {CONF_X_MAX}")
+    if config[CONF_Y_MIN] >= config[CONF_Y_MAX]:
+        raise cv.Invalid(f"{CONF_Y_MIN} must be less than {CONF_Y_MAX}")
+    return config
+
+
+# Raw controller coordinates, the same space as calibration
+WAKE_REGION_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Required(CONF_X_MIN): cv.int_range(min=0, max=4095),
+            cv.Required(CONF_X_MAX): cv.int_range(min=0, max=4095),
+            cv.Required(CONF_Y_MIN): cv.int_range(min=0, max=4095),
+            cv.Required(CONF_Y_MAX): cv.int_range(min=0, max=4095),
+        }
+    ),
+    _validate_wake_region,
+)
+
+# Raw coordinates to native panel pixels, before the configured transform:
+# x = a*raw_x + b*raw_y + c, y = d*raw_x + e*raw_y + f
+AFFINE_CALIBRATION_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_COEFFICIENTS): cv.All(
+            cv.ensure_list(cv.float_), cv.Length(min=6, max=6)
+        ),
+        cv.Optional(CONF_RESTORE, default=True): cv.boolean,
+        cv.Optional(CONF_ON_POINT): automation.validate_automation(single=True),
+        cv.Optional(CONF_ON_DONE): automation.validate_automation(single=True),
+    }
+)
+
+WAKE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_REGIONS): cv.ensure_list(WAKE_REGION_SCHEMA),
+        cv.Optional(CONF_TAP_COUNT, default=2): cv.int_range(min=1, max=5),
+        cv.Optional(
+            CONF_TAP_GAP, default="400ms"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(
+            CONF_HOLD_TIME, default="0ms"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_ON_WAKE): automation.validate_automation(single=True),
+    }
+)
+
+
+def _validate_acquisition_task(config):
+    if config[CONF_ACQUISITION_TASK]:
+        if CONF_INTERRUPT_PIN not in config:
+            raise cv.Invalid(
+                f"{CONF_ACQUISITION_TASK} is woken by the interrupt, set {CONF_INTERRUPT_PIN}"
+            )
+        if not CORE.is_esp32:
+            raise cv.Invalid(f"{CONF_ACQUISITION_TASK} is only available on ESP32")
+        if CONF_I2C_SCHEDULER_ID not in config:
+            LOGGER.warning(
+                "%s reads the bus outside the main loop, it is only safe if the "
+                "touch controller is alone on its I2C bus",
+                CONF_ACQUISITION_TASK,
+            )
+        else:
+            LOGGER.warning(
+                "%s reads the bus outside the main loop, it is only safe if every "
+                "other device on its I2C bus uses the same %s",
+                CONF_ACQUISITION_TASK,
+                CONF_I2C_SCHEDULER_ID,
+            )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     touchscreen.touchscreen_schema("100ms")
     .extend(
         {
             cv.GenerateID(): cv.declare_id(AXS5106Component),
             cv.Optional(CONF_INTERRUPT_PIN): pins.internal_gpio_input_pin_schema,
             cv.Optional(CONF_RESET_PIN): pins.gpio_output_pin_schema,
+            cv.Optional(CONF_ACQUISITION_TASK, default=False): cv.boolean,
+            cv.Optional(CONF_I2C_SCHEDULER_ID): cv.use_id(I2CScheduler),
+            cv.Optional(CONF_WAKE): WAKE_SCHEMA,
+            cv.Optional(CONF_AFFINE_CALIBRATION): AFFINE_CALIBRATION_SCHEMA,
         }
     )
-    .extend(i2c.i2c_device_schema(0x63))
+    .extend(i2c.i2c_device_schema(0x63)),
+    _validate_acquisition_task,
 )
 
 
+def _calibrate_actions(node):
+    if isinstance(node, dict):
+        for key, value in node.items():
+            if key == "axs5106.calibrate" and isinstance(value, dict):
+                yield value
+            yield from _calibrate_actions(value)
+    elif isinstance(node, list):
+        for item in node:
+            yield from _calibrate_actions(item)
+
+
+def _final_validate(config):
+    # Without the block the fit would be erased at the next boot, and nothing shows the targets
+    if CONF_AFFINE_CALIBRATION in config:
+        return config
+    for action in _calibrate_actions(fv.full_config.get()):
+        if action[CONF_ID].id == config[CONF_ID].id:
+            raise cv.Invalid(
+                f"axs5106.calibrate needs {CONF_AFFINE_CALIBRATION} set on '{config[CONF_ID].id}'"
+            )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await touchscreen.register_touchscreen(var, config)
     await i2c.register_i2c_device(var, config)
+    cg.add(var.set_calibration_key(config[CONF_ID].id))
 
     if interrupt_pin := config.get(CONF_INTERRUPT_PIN):
         cg.add(var.set_interrupt_pin(await cg.gpio_pin_expression(interrupt_pin)))
     if reset_pin := config.get(CONF_RESET_PIN):
         cg.add(var.set_reset_pin(await cg.gpio_pin_expression(reset_pin)))
+    if config[CONF_ACQUISITION_TASK]:
+        cg.add(var.set_acquisition_task(True))
+    if scheduler_id := config.get(CONF_I2C_SCHEDULER_ID):
+        cg.add(var.set_scheduler(await cg.get_variable(scheduler_id)))
+
+    if wake := config.get(CONF_WAKE):
+        for region in wake.get(CONF_REGIONS, []):
+            cg.add(
+                var.add_wake_region(
+                    region[CONF_X_MIN],
+                    region[CONF_X_MAX],
+                    region[CONF_Y_MIN],
+                    region[CONF_Y_MAX],
+                )
+            )
+        cg.add(var.set_wake_tap_count(wake[CONF_TAP_COUNT]))
+        cg.add(var.set_wake_tap_gap(wake[CONF_TAP_GAP]))
+        cg.add(var.set_wake_hold_time(wake[CONF_HOLD_TIME]))
+        if on_wake := wake.get(CONF_ON_WAKE):
+            await automation.build_automation(var.get_wake_trigger(), [], on_wake)
+
+    if affine := config.get(CONF_AFFINE_CALIBRATION):
+        if coefficients := affine.get(CONF_COEFFICIENTS):
+            cg.add(var.set_affine_calibration(*coefficients))
+        cg.add(var.set_restore_calibration(affine[CONF_RESTORE]))
+        if on_point := affine.get(CONF_ON_POINT):
+            await automation.build_automation(
+                var.get_calibration_point_trigger(),
+                [(cg.uint8, "index"), (cg.int16, "x"), (cg.int16, "y")],
+                on_point,
+            )
+        if on_done := affine.get(CONF_ON_DONE):
+            await automation.build_automation(
+                var.get_calibration_done_trigger(), [(cg.bool_, "success")], on_done
+            )
+
+
+AXS5106_ACTION_SCHEMA = automation.maybe_simple_id(
+    {
+        cv.GenerateID(): cv.use_id(AXS5106Component),
+    }
+)
+
+
+@automation.register_action("axs5106.screen_off", ScreenOffAction, AXS5106_ACTION_SCHEMA)
+@automation.register_action("axs5106.screen_on", ScreenOnAction, AXS5106_ACTION_SCHEMA)
+@automation.register_action(
+    "axs5106.reset_calibration", ResetCalibrationAction, AXS5106_ACTION_SCHEMA
+)
+async def axs5106_screen_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "axs5106.calibrate",
+    CalibrateAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(AXS5106Component),
+            # Reported coordinates, spread out towards the corners
+            cv.Required(CONF_POINTS): cv.All(
+                cv.ensure_list(
+                    cv.Schema(
+                        {
+                            cv.Required(CONF_X): cv.int_range(min=0, max=32767),
+                            cv.Required(CONF_Y): cv.int_range(min=0, max=32767),
+                        }
+                    )
+                ),
+                cv.Length(min=3, max=5),
+            ),
+        }
+    ),
+)
+async def axs5106_calibrate_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    for point in config[CONF_POINTS]:
+        cg.add(var.add_target(point[CONF_X], point[CONF_Y]))
+    return var
@@ -0,0 +1,43 @@
+from esphome import automation
+import esphome.codegen as cg
+import esphome.config_validation as cv
+
+from esphome.const import CONF_ID, CONF_SIZE
+
+CODEOWNERS = ["@widget"]
+
+event_trace_ns = cg.esphome_ns.namespace("event_trace")
+
+EventTrace = event_trace_ns.class_("EventTrace", cg.Component)
+DumpAction = event_trace_ns.class_("DumpAction", automation.Action)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(EventTrace),
+        # 12 bytes per record
+        cv.Optional(CONF_SIZE, default=256): cv.int_range(min=16, max=4096),
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    cg.add_define("USE_EVENT_TRACE")
+    cg.add_define("EVENT_TRACE_SIZE", config[CONF_SIZE])
+
+
+@automation.register_action(
+    "event_trace.dump",
+    DumpAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(EventTrace),
+        }
+    ),
+)
+async def event_trace_dump_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
@@ -0,0 +1,47 @@
+#include "event_trace.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <atomic>
+#include <cinttypes>
+
+namespace esphome {
+namespace event_trace {
+
+static const char *const TAG = "event_trace";
+
+// Records per log line, keeps lines well under the logger buffer
+static const size_t RECORDS_PER_LINE = 4;
+
+static TraceRecord trace_buffer[EVENT_TRACE_SIZE];
+static std::atomic<uint32_t> trace_head{0};
+
+void record(uint16_t event, int16_t arg0, int32_t arg1) {
+  uint32_t idx = trace_head.fetch_add(1, std::memory_order_relaxed) % EVENT_TRACE_SIZE;
+  trace_buffer[idx] = TraceRecord{micros(), event, arg0, arg1};
+}
+
+void EventTrace::dump() {
+  uint32_t written = trace_head.load();
+  uint32_t count = written < EVENT_TRACE_SIZE ? written : EVENT_TRACE_SIZE;
+  uint32_t start = written - count;
+
+  ESP_LOGI(TAG, "Dumping %" PRIu32 " of %" PRIu32 " records, now=%" PRIu32, count, written, micros());
+  for (uint32_t i = 0; i < count; i += RECORDS_PER_LINE) {
+    TraceRecord line[RECORDS_PER_LINE];
+    size_t n = 0;
+    for (; n < RECORDS_PER_LINE && i + n < count; n++) {
+      line[n] = trace_buffer[(start + i + n) % EVENT_TRACE_SIZE];
+    }
+    ESP_LOGI(TAG, "%s", format_hex(reinterpret_cast<uint8_t *>(line), n * sizeof(TraceRecord)).c_str());
+  }
+}
+
+void EventTrace::dump_config() {
+  ESP_LOGCONFIG(TAG, "Event Trace:");
+  ESP_LOGCONFIG(TAG, "  Records: %u (%u bytes)", (unsigned) EVENT_TRACE_SIZE,
+                (unsigned) (EVENT_TRACE_SIZE * sizeof(TraceRecord)));
+}
+
+}  // namespace event_trace
+}  // namespace esphome
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+
+#ifndef EVENT_TRACE_SIZE
+#define EVENT_TRACE_SIZE 256
+#endif
+
+namespace esphome {
+namespace event_trace {
+
+/* Event ids, the high byte is the source driver.
+ * Keep scripts/decode_trace.py in step with this list.
+ */
+enum TraceEvent : uint16_t {
+  // arg0 = x, arg1 = touch index << 16 | y
+  AXS5106_TOUCH = 0x0100,
+  // End of gesture, no args
+  AXS5106_RELEASE = 0x0101,
+  AXS5106_READ_FAILED = 0x0102,
+
+  // arg0 = IRQ2 << 8 | IRQ1, arg1 = IRQ3
+  AXP202_IRQ = 0x0200,
+  // arg0 = raw fuel gauge register
+  AXP202_FUEL_GAUGE = 0x0201,
+};
+
+/// Fixed size so the dump is a straight copy of the buffer.
+struct TraceRecord {
+  uint32_t timestamp;  // micros()
+  uint16_t event;
+  int16_t arg0;
+  int32_t arg1;
+};
+static_assert(sizeof(TraceRecord) == 12, "decode_trace.py expects 12 byte records");
+
+/// Append a record to the ring, the oldest is overwritten once full. Safe from any task, not from an ISR.
+void record(uint16_t event, int16_t arg0 = 0, int32_t arg1 = 0);
+
+class EventTrace : public Component {
+ public:
+  void dump_config() override;
+
+  /// Log the buffer oldest first as raw hex, decode it with scripts/decode_trace.py.
+  void dump();
+};
+
+template<typename... Ts> class DumpAction : public Action<Ts...>, public Parented<EventTrace> {
+ public:
+  void play(const Ts &...x) override { this->parent_->dump(); }
+};
+
+}  // namespace event_trace
+}  // namespace esphome
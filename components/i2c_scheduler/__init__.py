@@ -0,0 +1,37 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+
+from esphome.const import CONF_ID
+
+CODEOWNERS = ["@widget"]
+MULTI_CONF = True
+
+i2c_scheduler_ns = cg.esphome_ns.namespace("i2c_scheduler")
+
+I2CScheduler = i2c_scheduler_ns.class_("I2CScheduler", cg.Component)
+
+# Key drivers use to point at a scheduler
+CONF_I2C_SCHEDULER_ID = "i2c_scheduler_id"
+CONF_IDLE_GAP = "idle_gap"
+CONF_MAX_DEFERRAL = "max_deferral"
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(I2CScheduler),
+        cv.Optional(
+            CONF_IDLE_GAP, default="50ms"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(
+            CONF_MAX_DEFERRAL, default="2s"
+        ): cv.positive_time_period_milliseconds,
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    cg.add_define("USE_I2C_SCHEDULER")
+    cg.add(var.set_idle_gap(config[CONF_IDLE_GAP]))
+    cg.add(var.set_max_deferral(config[CONF_MAX_DEFERRAL]))
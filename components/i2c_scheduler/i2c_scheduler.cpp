@@ -0,0 +1,58 @@
+#include "i2c_scheduler.h"
+
+#include <cinttypes>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace i2c_scheduler {
+
+static const char *const TAG = "i2c_scheduler";
+
+void I2CScheduler::setup() {
+  // Nothing to do until something is submitted
+  this->disable_loop();
+}
+
+void I2CScheduler::submit(std::function<void()> &&job) {
+  this->jobs_.push_back(Job{std::move(job), millis() + this->max_deferral_});
+  this->enable_loop();
+}
+
+void I2CScheduler::unlock(TransactionPriority priority) {
+  if (priority == PRIORITY_CRITICAL)
+    this->last_critical_.store(millis());
+  this->lock_.unlock();
+}
+
+void I2CScheduler::loop() {
+  /* In an idle gap the whole backlog goes out as one batch. While critical
+   * traffic is flowing only jobs past their deadline are allowed through.
+   * Each job locks per transaction, so a critical read from another task
+   * only ever waits for a single background transaction.
+   */
+  size_t i = 0;
+  while (i < this->jobs_.size()) {
+    uint32_t now = millis();
+    if (this->is_idle_(now) || (int32_t) (now - this->jobs_[i].deadline) >= 0) {
+      auto fn = std::move(this->jobs_[i].fn);
+      this->jobs_.erase(this->jobs_.begin() + i);
+      fn();
+    } else {
+      i++;
+    }
+  }
+
+  if (this->jobs_.empty())
+    this->disable_loop();
+}
+
+void I2CScheduler::dump_config() {
+  ESP_LOGCONFIG(TAG, "I2C Scheduler:");
+  ESP_LOGCONFIG(TAG, "  Idle Gap: %" PRIu32 "ms", this->idle_gap_);
+  ESP_LOGCONFIG(TAG, "  Max Deferral: %" PRIu32 "ms", this->max_deferral_);
+}
+
+}  // namespace i2c_scheduler
+}  // namespace esphome
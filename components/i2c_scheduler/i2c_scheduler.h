@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace i2c_scheduler {
+
+enum TransactionPriority : uint8_t {
+  /// Runs at once and holds background work off for the idle gap, e.g. touch reads
+  PRIORITY_CRITICAL,
+  /// Housekeeping, e.g. PMU telemetry
+  PRIORITY_BACKGROUND,
+};
+
+/* Arbitrates the devices sharing one bus.
+ *
+ * Every transaction of a participating device holds the bus lock, so a
+ * device read from its own task can share the bus with ones read from the
+ * main loop. Background work is submitted as a job and run in the gaps
+ * between critical transactions, or once its deadline has passed.
+ */
+class I2CScheduler : public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::BUS; }
+
+  void set_idle_gap(uint32_t idle_gap) { this->idle_gap_ = idle_gap; }
+  void set_max_deferral(uint32_t max_deferral) { this->max_deferral_ = max_deferral; }
+
+  /// Queue background work, it runs in the next idle gap or after max_deferral at the latest. Main loop only.
+  void submit(std::function<void()> &&job);
+
+  // Held for the duration of one transaction, use BusLock rather than calling these
+  void lock() { this->lock_.lock(); }
+  void unlock(TransactionPriority priority);
+
+ protected:
+  struct Job {
+    std::function<void()> fn;
+    uint32_t deadline;
+  };
+
+  bool is_idle_(uint32_t now) const { return now - this->last_critical_.load() >= this->idle_gap_; }
+
+  Mutex lock_;
+  std::vector<Job> jobs_;
+  std::atomic<uint32_t> last_critical_{0};
+  uint32_t idle_gap_{50};
+  uint32_t max_deferral_{2000};
+};
+
+/// Holds the bus for one transaction, a null scheduler makes it a no-op.
+class BusLock {
+ public:
+  BusLock(I2CScheduler *scheduler, TransactionPriority priority) : scheduler_(scheduler), priority_(priority) {
+    if (this->scheduler_ != nullptr)
+      this->scheduler_->lock();
+  }
+  ~BusLock() {
+    if (this->scheduler_ != nullptr)
+      this->scheduler_->unlock(this->priority_);
+  }
+  BusLock(const BusLock &) = delete;
+  BusLock &operator=(const BusLock &) = delete;
+
+ protected:
+  I2CScheduler *scheduler_;
+  TransactionPriority priority_;
+};
+
+}  // namespace i2c_scheduler
+}  // namespace esphome
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Decode an event_trace dump out of an ESPHome log.
+
+    esphome logs watch.yaml | tee log.txt
+    # run the event_trace.dump action
+    python3 scripts/decode_trace.py log.txt
+
+Reads stdin when no file is given.
+"""
+
+import re
+import struct
+import sys
+
+# Keep in step with TraceEvent in components/event_trace/event_trace.h
+EVENTS = {
+    0x0100: "axs5106.touch",
+    0x0101: "axs5106.release",
+    0x0102: "axs5106.read_failed",
+    0x0200: "axp202.irq",
+    0x0201: "axp202.fuel_gauge",
+}
+
+RECORD = struct.Struct("<IHhi")
+ANSI = re.compile(r"\x1b\[[0-9;]*m")
+DATA_LINE = re.compile(r"\[event_trace[^\]]*\]: ([0-9a-f]+)\s*$")
+HEADER_LINE = re.compile(r"\[event_trace[^\]]*\]: Dumping")
+
+
+def describe(event, arg0, arg1):
+    if event == 0x0100:
+        return f"#{arg1 >> 16} x={arg0} y={arg1 & 0xFFFF}"
+    if event == 0x0200:
+        return f"IRQ1=0x{arg0 & 0xFF:02x} IRQ2=0x{(arg0 >> 8) & 0xFF:02x} IRQ3=0x{arg1 & 0xFF:02x}"
+    if event == 0x0201:
+        return f"raw=0x{arg0 & 0xFF:02x} level={0 if arg0 & 0x80 else arg0 & 0x7F}%"
+    return f"{arg0} {arg1}"
+
+
+def decode(lines):
+    records = []
+    for line in lines:
+        line = ANSI.sub("", line)
+        if HEADER_LINE.search(line):
+            # Only the latest dump is of interest
+            records = []
+        elif match := DATA_LINE.search(line):
+            raw = bytes.fromhex(match.group(1))
+            records.extend(RECORD.iter_unpack(raw))
+    return records
+
+
+def main():
+    with open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin as f:
+        records = decode(f)
+
+    if not records:
+        print("No event_trace dump found", file=sys.stderr)
+        return 1
+
+    start = records[0][0]
+    for timestamp, event, arg0, arg1 in records:
+        name = EVENTS.get(event, f"0x{event:04x}")
+        # micros() wraps every ~71 minutes
+        delta = (timestamp - start) & 0xFFFFFFFF
+        print(f"{delta / 1000:12.3f}ms  {name:<20} {describe(event, arg0, arg1)}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())